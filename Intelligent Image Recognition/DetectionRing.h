@@ -0,0 +1,310 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include <opencv2\opencv.hpp>
+#include <boost\version.hpp>
+#include <boost\date_time\posix_time\posix_time_types.hpp>
+#include <boost\interprocess\shared_memory_object.hpp>
+#include <boost\interprocess\mapped_region.hpp>
+#include <boost\interprocess\sync\interprocess_condition.hpp>
+#include <boost\interprocess\sync\interprocess_mutex.hpp>
+#include <boost\interprocess\sync\scoped_lock.hpp>
+
+// Shared between the detection service (--service) and the processes that call it.
+// A client includes this header only; it must be built against the same Boost version as the service,
+// which DetectionClient checks on attach. See README for the Acquire -> fill -> Detect protocol.
+
+// Request ring shared between the detection service and its clients.
+// A client writes its gray frame straight into a slot, the service detects on that memory in place.
+// A slot left in Writing or Done longer than the service's lease (client died) is taken back.
+struct DetectionSlot
+{
+    enum : std::uint32_t { Free, Writing, Ready, Busy, Done };
+
+    static constexpr int MaxWidth = 640;
+    static constexpr int MaxHeight = 480;
+    static constexpr std::size_t MaxRects = 32;
+
+    std::uint32_t _State;
+    std::uint32_t _Abandoned;
+    std::uint64_t _Sequence;
+    std::int64_t _StateTicks;
+    std::int32_t _Width;
+    std::int32_t _Height;
+    std::int64_t _SubmitTicks;
+    std::int64_t _LatencyMicroseconds;
+    std::uint32_t _RectCount;
+    std::int32_t _Rects[MaxRects][4];
+    unsigned char _Pixels[MaxWidth * MaxHeight];
+};
+
+// Fixed at the start of the segment in every version, so any build can tell
+// whether a segment belongs to a live service and whether its layout matches.
+struct DetectionRingHeader
+{
+    std::uint32_t _Magic;
+    std::uint32_t _Version;
+    std::uint64_t _Size;
+    std::uint64_t _BoostVersion;
+    std::atomic<std::int64_t> _HeartbeatTicks;
+};
+
+struct DetectionRing
+{
+    static constexpr std::size_t SlotCount = 16;
+    static constexpr std::uint32_t Magic = 0x52444949;  // "IIDR"
+    static constexpr std::uint32_t Version = 1;
+
+    static decltype(auto) GetName()
+    {
+        return "IntelligentImageRecognition.Detection";
+    }
+
+    static decltype(auto) GetTicks()
+    {
+        using namespace std::chrono;
+        return static_cast<std::int64_t>(duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count());
+    }
+
+    // the mapping holds a ring with this build's layout, including the Boost synchronization types
+    static decltype(auto) IsCompatible(const void* _Address, std::size_t _RegionSize)
+    {
+        auto _Header = static_cast<const DetectionRingHeader*>(_Address);
+
+        return
+            sizeof(DetectionRing) <= _RegionSize &&
+            Magic == _Header->_Magic &&
+            Version == _Header->_Version &&
+            sizeof(DetectionRing) == _Header->_Size &&
+            BOOST_VERSION == _Header->_BoostVersion;
+    }
+
+    // a service of any version is still beating within _Timeout
+    static decltype(auto) IsAlive(const void* _Address, std::size_t _RegionSize, std::chrono::nanoseconds _Timeout)
+    {
+        auto _Header = static_cast<const DetectionRingHeader*>(_Address);
+
+        return
+            sizeof(DetectionRingHeader) <= _RegionSize &&
+            Magic == _Header->_Magic &&
+            GetTicks() - _Header->_HeartbeatTicks.load() < _Timeout.count();
+    }
+
+    DetectionRingHeader _Header;
+    boost::interprocess::interprocess_mutex _Mutex;
+    boost::interprocess::interprocess_condition _RequestCondition;
+    boost::interprocess::interprocess_condition _ResponseCondition;
+    bool _Running;
+    DetectionSlot _Slots[SlotCount];
+};
+
+enum class DetectionStatus
+{
+    Success,
+    Rejected,   // frame is not CV_8UC1 or larger than the slot
+    Timeout,    // no free slot or no result in time
+    Stopped,    // service is shutting down
+    Expired     // slot was held past the lease and reclaimed
+};
+
+class DetectionClient
+{
+public:
+    // Throws boost::interprocess::interprocess_exception when no service is running and
+    // std::runtime_error when the service was built with another ring layout or Boost version.
+    // _Wait bounds every wait on the service; a slot must be submitted and collected within the service lease.
+    DetectionClient(std::chrono::milliseconds _Wait = std::chrono::milliseconds(5000)) :
+        _SharedMemory(boost::interprocess::open_only, DetectionRing::GetName(), boost::interprocess::read_write),
+        _Region(_SharedMemory, boost::interprocess::read_write),
+        _Ring(static_cast<DetectionRing*>(_Region.get_address())),
+        _Timeout(_Wait)
+    {
+        if (!DetectionRing::IsCompatible(_Region.get_address(), _Region.get_size()))
+        {
+            throw std::runtime_error("detection ring layout does not match this client, rebuild it against the service's DetectionRing.h");
+        }
+    }
+
+    // Reserves a slot and returns it with a frame header over the shared pixels, so the caller can fill it in place.
+    // The index is SlotCount on failure, see GetStatus().
+    decltype(auto) Acquire(int _Width = DetectionSlot::MaxWidth, int _Height = DetectionSlot::MaxHeight)
+    {
+        auto _Result = std::make_pair(static_cast<std::size_t>(DetectionRing::SlotCount), cv::Mat());
+        if (_Width <= 0 || _Height <= 0 || DetectionSlot::MaxWidth < _Width || DetectionSlot::MaxHeight < _Height)
+        {
+            _Status = DetectionStatus::Rejected;
+            return _Result;
+        }
+
+        auto _Deadline = GetDeadline();
+        boost::interprocess::scoped_lock<boost::interprocess::interprocess_mutex> _Lock(_Ring->_Mutex);
+
+        while (_Ring->_Running)
+        {
+            for (std::size_t _Index = 0; _Index < DetectionRing::SlotCount; _Index++)
+            {
+                auto& _Slot = _Ring->_Slots[_Index];
+                if (DetectionSlot::Free == _Slot._State)
+                {
+                    _Slot._State = DetectionSlot::Writing;
+                    _Slot._Abandoned = 0;
+                    _Slot._StateTicks = DetectionRing::GetTicks();
+                    _Slot._Width = _Width;
+                    _Slot._Height = _Height;
+                    _SequenceList[_Index] = ++_Slot._Sequence;
+
+                    _Status = DetectionStatus::Success;
+                    _Result.first = _Index;
+                    _Result.second = cv::Mat(_Height, _Width, CV_8UC1, _Slot._Pixels);
+                    return _Result;
+                }
+            }
+
+            if (!_Ring->_ResponseCondition.timed_wait(_Lock, _Deadline))
+            {
+                _Status = DetectionStatus::Timeout;
+                return _Result;
+            }
+        }
+
+        _Status = DetectionStatus::Stopped;
+        return _Result;
+    }
+
+    // gives back an acquired slot that will not be submitted
+    decltype(auto) Release(std::size_t _Index)
+    {
+        if (DetectionRing::SlotCount <= _Index)
+        {
+            return;
+        }
+
+        boost::interprocess::scoped_lock<boost::interprocess::interprocess_mutex> _Lock(_Ring->_Mutex);
+        auto& _Slot = _Ring->_Slots[_Index];
+        if (_SequenceList[_Index] == _Slot._Sequence && DetectionSlot::Writing == _Slot._State)
+        {
+            _Slot._State = DetectionSlot::Free;
+            _Ring->_ResponseCondition.notify_all();
+        }
+    }
+
+    // Submits an acquired slot and waits for its detections, then frees the slot.
+    decltype(auto) Detect(std::size_t _Index)
+    {
+        std::vector<cv::Rect> _vRect;
+        if (DetectionRing::SlotCount <= _Index)
+        {
+            _Status = DetectionStatus::Rejected;
+            return _vRect;
+        }
+
+        auto& _Slot = _Ring->_Slots[_Index];
+        auto _Sequence = _SequenceList[_Index];
+        boost::interprocess::scoped_lock<boost::interprocess::interprocess_mutex> _Lock(_Ring->_Mutex);
+
+        if (_Sequence != _Slot._Sequence || DetectionSlot::Writing != _Slot._State)
+        {
+            _Status = DetectionStatus::Expired;
+            return _vRect;
+        }
+
+        _Slot._SubmitTicks = DetectionRing::GetTicks();
+        _Slot._State = DetectionSlot::Ready;
+        _Ring->_RequestCondition.notify_one();
+
+        auto _Deadline = GetDeadline();
+        while (_Ring->_Running && _Sequence == _Slot._Sequence && DetectionSlot::Done != _Slot._State)
+        {
+            if (!_Ring->_ResponseCondition.timed_wait(_Lock, _Deadline))
+            {
+                break;
+            }
+        }
+
+        if (_Sequence != _Slot._Sequence)
+        {
+            _Status = DetectionStatus::Expired;
+            return _vRect;
+        }
+
+        if (DetectionSlot::Done != _Slot._State)
+        {
+            // a queued request is dropped, a running one frees its slot when the worker finishes
+            if (DetectionSlot::Ready == _Slot._State)
+            {
+                _Slot._State = DetectionSlot::Free;
+                _Ring->_ResponseCondition.notify_all();
+            }
+            else
+            {
+                _Slot._Abandoned = 1;
+            }
+
+            _Status = _Ring->_Running ? DetectionStatus::Timeout : DetectionStatus::Stopped;
+            return _vRect;
+        }
+
+        for (std::size_t _Rect = 0; _Rect < _Slot._RectCount; _Rect++)
+        {
+            _vRect.emplace_back(_Slot._Rects[_Rect][0], _Slot._Rects[_Rect][1], _Slot._Rects[_Rect][2], _Slot._Rects[_Rect][3]);
+        }
+        _LatencyMicroseconds = _Slot._LatencyMicroseconds;
+
+        _Slot._State = DetectionSlot::Free;
+        _Ring->_ResponseCondition.notify_all();
+
+        _Status = DetectionStatus::Success;
+        return _vRect;
+    }
+
+    // convenience for callers that already hold a gray frame elsewhere
+    decltype(auto) Detect(cv::Mat _Image)
+    {
+        if (_Image.empty() || CV_8UC1 != _Image.type() ||
+            DetectionSlot::MaxWidth < _Image.cols || DetectionSlot::MaxHeight < _Image.rows)
+        {
+            _Status = DetectionStatus::Rejected;
+            return std::vector<cv::Rect>();
+        }
+
+        auto&& _Pair = Acquire(_Image.cols, _Image.rows);
+        if (DetectionRing::SlotCount <= _Pair.first)
+        {
+            return std::vector<cv::Rect>();
+        }
+
+        // same size and type, so this writes into the shared slot
+        _Image.copyTo(_Pair.second);
+        return Detect(_Pair.first);
+    }
+
+    decltype(auto) GetStatus() const
+    {
+        return _Status;
+    }
+
+    decltype(auto) GetLatency() const
+    {
+        return _LatencyMicroseconds;
+    }
+
+private:
+    boost::posix_time::ptime GetDeadline() const
+    {
+        return boost::posix_time::microsec_clock::universal_time() + boost::posix_time::milliseconds(_Timeout.count());
+    }
+
+    boost::interprocess::shared_memory_object _SharedMemory;
+    boost::interprocess::mapped_region _Region;
+    DetectionRing* _Ring;
+    std::chrono::milliseconds _Timeout;
+    std::array<std::uint64_t, DetectionRing::SlotCount> _SequenceList = {};
+    DetectionStatus _Status = DetectionStatus::Success;
+    std::int64_t _LatencyMicroseconds = 0;
+};
@@ -1,5 +1,10 @@
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
 #include <filesystem>
 #include <list>
 #include <iterator>
@@ -7,12 +12,24 @@
 #include <utility>
 #include <locale>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <thread>
 #include <vector>
 #include <type_traits>
 #include <opencv2\opencv.hpp>
 #include <boost\filesystem.hpp>
+#include <boost\iostreams\device\mapped_file.hpp>
+#include <boost\interprocess\shared_memory_object.hpp>
+#include <boost\interprocess\mapped_region.hpp>
+#include <boost\interprocess\sync\interprocess_condition.hpp>
+#include <boost\interprocess\sync\interprocess_mutex.hpp>
+#include <boost\interprocess\sync\scoped_lock.hpp>
+#include "DetectionRing.h"
 
 template<typename Directory>
 decltype(auto) GetFileList(Directory&& _DirectoryName)
@@ -42,15 +59,269 @@ auto GetImageSize(File&& _ImagePath)
     return _Pair;
 }
 
+template<typename Directory>
+decltype(auto) GetFrameList(Directory&& _DirectoryName)
+{
+    auto _FileList = GetFileList(std::forward<Directory>(_DirectoryName));
+
+    auto GetFrameNumber = [](auto&& _File)
+    {
+        auto&& _Stem = boost::filesystem::path(_File).stem().string();
+        return std::strtoull(_Stem.c_str(), nullptr, 10);
+    };
+
+    std::sort(std::begin(_FileList), std::end(_FileList), [&](auto&& _File1, auto&& _File2)
+    {
+        return GetFrameNumber(_File1) < GetFrameNumber(_File2);
+    });
+
+    return _FileList;
+}
+
+// Single-file frame archive.
+// Layout: header, PNG encoded frames, then an offset table of (count + 1) entries,
+// so frame i occupies [offset[i], offset[i + 1]).
+// The header and table are written on Close; an archive without them (killed recording)
+// is indexed again on open by walking the PNG chunks.
+struct FrameArchiveHeader
+{
+    char _Magic[4];
+    std::uint32_t _Version;
+    std::uint64_t _Count;
+    std::uint64_t _IndexOffset;
+};
+
+static constexpr char FrameArchiveMagic[4] = { 'I', 'I', 'R', 'F' };
+static constexpr std::uint32_t FrameArchiveVersion = 1;
+
+class FrameArchiveWriter
+{
+public:
+    template<typename PathType>
+    FrameArchiveWriter(PathType&& _Path) :
+        _FileStream(boost::filesystem::path(std::forward<PathType>(_Path)).native(), std::ios::binary | std::ios::trunc)
+    {
+        FrameArchiveHeader _Header = {};
+        _FileStream.write(reinterpret_cast<const char*>(&_Header), sizeof(_Header));
+    }
+
+    FrameArchiveWriter(const FrameArchiveWriter&) = delete;
+    FrameArchiveWriter& operator=(const FrameArchiveWriter&) = delete;
+
+    ~FrameArchiveWriter()
+    {
+        Close();
+    }
+
+    decltype(auto) Append(cv::Mat _Frame)
+    {
+        // PNG level 1: the fastest zlib level that still compresses, lossless either way
+        static const std::vector<int> _Params = { cv::IMWRITE_PNG_COMPRESSION, 1 };
+
+        if (_Frame.empty())
+        {
+            return;
+        }
+
+        std::vector<uchar> _Buffer;
+        cv::imencode(".png", _Frame, _Buffer, _Params);
+
+        _OffsetList.push_back(static_cast<std::uint64_t>(_FileStream.tellp()));
+        _FileStream.write(reinterpret_cast<const char*>(_Buffer.data()), _Buffer.size());
+    }
+
+    void Close()
+    {
+        if (!_FileStream.is_open())
+        {
+            return;
+        }
+
+        FrameArchiveHeader _Header = {};
+        std::memcpy(_Header._Magic, FrameArchiveMagic, sizeof(FrameArchiveMagic));
+        _Header._Version = FrameArchiveVersion;
+        _Header._Count = _OffsetList.size();
+        _Header._IndexOffset = static_cast<std::uint64_t>(_FileStream.tellp());
+
+        _OffsetList.push_back(_Header._IndexOffset);
+        _FileStream.write(reinterpret_cast<const char*>(_OffsetList.data()), _OffsetList.size() * sizeof(std::uint64_t));
+
+        _FileStream.seekp(0);
+        _FileStream.write(reinterpret_cast<const char*>(&_Header), sizeof(_Header));
+        _FileStream.close();
+    }
+
+private:
+    std::ofstream _FileStream;
+    std::vector<std::uint64_t> _OffsetList;
+};
+
+class FrameArchive
+{
+public:
+    FrameArchive() = default;
+
+    template<typename PathType>
+    FrameArchive(PathType&& _Path)
+    {
+        boost::filesystem::path _ArchivePath(std::forward<PathType>(_Path));
+        if (!boost::filesystem::exists(_ArchivePath) ||
+            boost::filesystem::file_size(_ArchivePath) < sizeof(FrameArchiveHeader))
+        {
+            return;
+        }
+
+        _MappedFile.open(_ArchivePath);
+        if (!ReadIndex())
+        {
+            RecoverIndex();
+        }
+    }
+
+    decltype(auto) size() const
+    {
+        return _OffsetList.empty() ? std::size_t(0) : _OffsetList.size() - 1;
+    }
+
+    decltype(auto) empty() const
+    {
+        return 0 == size();
+    }
+
+    // decodes straight out of the mapping, no copy of the compressed bytes
+    decltype(auto) Read(std::size_t _Index, int _Flags = cv::IMREAD_COLOR) const
+    {
+        if (_Index >= size())
+        {
+            return cv::Mat();
+        }
+
+        cv::Mat _Buffer(1, static_cast<int>(_OffsetList[_Index + 1] - _OffsetList[_Index]), CV_8UC1,
+            const_cast<char*>(_MappedFile.data() + _OffsetList[_Index]));
+
+        return cv::imdecode(_Buffer, _Flags);
+    }
+
+private:
+    // loads the offset table written by Close, rejecting any offset outside the frame area
+    bool ReadIndex()
+    {
+        FrameArchiveHeader _Header;
+        std::memcpy(&_Header, _MappedFile.data(), sizeof(_Header));
+
+        if (0 != std::memcmp(_Header._Magic, FrameArchiveMagic, sizeof(FrameArchiveMagic)) ||
+            FrameArchiveVersion != _Header._Version ||
+            _Header._IndexOffset > _MappedFile.size() ||
+            _Header._Count >= (_MappedFile.size() - _Header._IndexOffset) / sizeof(std::uint64_t))
+        {
+            return false;
+        }
+
+        _OffsetList.resize(static_cast<std::size_t>(_Header._Count + 1));
+        std::memcpy(_OffsetList.data(), _MappedFile.data() + _Header._IndexOffset, _OffsetList.size() * sizeof(std::uint64_t));
+
+        auto _Previous = static_cast<std::uint64_t>(sizeof(FrameArchiveHeader));
+        for (auto&& _Offset : _OffsetList)
+        {
+            if (_Offset < _Previous || _Offset > _Header._IndexOffset)
+            {
+                _OffsetList.clear();
+                return false;
+            }
+            _Previous = _Offset;
+        }
+
+        return _Header._IndexOffset == _OffsetList.back();
+    }
+
+    // rebuilds the offsets from the complete PNG images following the header, dropping a truncated tail
+    void RecoverIndex()
+    {
+        static const unsigned char _Signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+        auto _Data = reinterpret_cast<const unsigned char*>(_MappedFile.data());
+        auto _Size = static_cast<std::uint64_t>(_MappedFile.size());
+        auto _Offset = static_cast<std::uint64_t>(sizeof(FrameArchiveHeader));
+
+        _OffsetList.clear();
+        while (_Offset + sizeof(_Signature) <= _Size && 0 == std::memcmp(_Data + _Offset, _Signature, sizeof(_Signature)))
+        {
+            // chunk: 4 byte big endian length, 4 byte type, data, 4 byte CRC
+            auto _Chunk = _Offset + sizeof(_Signature);
+            bool _Complete = false;
+
+            while (!_Complete && _Chunk + 12 <= _Size)
+            {
+                std::uint64_t _Length =
+                    static_cast<std::uint64_t>(_Data[_Chunk]) << 24 |
+                    static_cast<std::uint64_t>(_Data[_Chunk + 1]) << 16 |
+                    static_cast<std::uint64_t>(_Data[_Chunk + 2]) << 8 |
+                    static_cast<std::uint64_t>(_Data[_Chunk + 3]);
+
+                if (_Chunk + 12 + _Length > _Size)
+                {
+                    break;
+                }
+
+                _Complete = 0 == std::memcmp(_Data + _Chunk + 4, "IEND", 4);
+                _Chunk += 12 + _Length;
+            }
+
+            if (!_Complete)
+            {
+                break;
+            }
+
+            _OffsetList.push_back(_Offset);
+            _Offset = _Chunk;
+        }
+
+        if (!_OffsetList.empty())
+        {
+            _OffsetList.push_back(_Offset);
+        }
+    }
+
+    boost::iostreams::mapped_file_source _MappedFile;
+    std::vector<std::uint64_t> _OffsetList;
+};
+
+template<typename Directory, typename PathType>
+decltype(auto) ConvertFrameDirectory(Directory&& _DirectoryName, PathType&& _ArchivePath)
+{
+    FrameArchiveWriter _Writer(std::forward<PathType>(_ArchivePath));
+
+    // files that are not images (desktop.ini, notes) read as empty and are skipped by Append
+    for (auto&& _File : GetFrameList(std::forward<Directory>(_DirectoryName)))
+    {
+        _Writer.Append(cv::imread(_File, cv::IMREAD_GRAYSCALE));
+    }
+}
+
+template<typename Directory, typename PathType>
+decltype(auto) OpenFrameArchive(Directory&& _DirectoryName, PathType&& _ArchivePath)
+{
+    // convert again when frames were added to or removed from the directory after the last conversion
+    if (boost::filesystem::exists(_DirectoryName) &&
+        (!boost::filesystem::exists(_ArchivePath) ||
+            boost::filesystem::last_write_time(_ArchivePath) < boost::filesystem::last_write_time(_DirectoryName)))
+    {
+        ConvertFrameDirectory(_DirectoryName, _ArchivePath);
+    }
+
+    return FrameArchive(std::forward<PathType>(_ArchivePath));
+}
+
 struct FileControl
 {
     boost::filesystem::path _PositivesDirectory{ "Positives" };
     boost::filesystem::path _NegativesDirectory{ "Negatives" };
     boost::filesystem::path _PredictionDirectory{ "Prediction" };
+    boost::filesystem::path _PredictionArchivePath{ "Prediction.frames" };
 
     std::vector<std::string> _PositivesSample = GetFileList(_PositivesDirectory);
     std::vector<std::string> _NegativesSample = GetFileList(_NegativesDirectory);
-    std::vector<std::string> _PredictionSample = GetFileList(_PredictionDirectory);
+    FrameArchive _PredictionArchive = OpenFrameArchive(_PredictionDirectory, _PredictionArchivePath);
 
     decltype(auto) AddPositives(cv::Mat _Mat)
     {
@@ -133,8 +404,9 @@ class Haar
 public:
     Haar() = default;
 
+    // _FeatureType is HAAR or LBP; LBP trains and detects several times faster
     template<typename PathType>
-    Haar(PathType&& _Path) :
+    Haar(PathType&& _Path, const std::string& _FeatureType = "HAAR") :
         _Directory(std::forward<PathType>(_Path)),
         _PositiveText(_Directory / "Positive.txt"),
         _NegativeText(_Directory / "Negative.txt"),
@@ -150,10 +422,11 @@ public:
         SetArguments("-info", _PositiveText.string());
         SetArguments("-bg", _NegativeText.string());
         SetArguments("-vec", _PositiveVector.string());
+        SetArguments("-featureType", _FeatureType);
 
         SetArguments("-weightTrimRate", 0.95);
-        SetArguments("-maxDepth ", 1);
-        SetArguments("-maxWeakCount ", 100);
+        SetArguments("-maxDepth", 1);
+        SetArguments("-maxWeakCount", 100);
         SetArguments("-mode", "ALL");
     }
 
@@ -205,6 +478,17 @@ public:
         _ArgumentsMap[std::forward<ArgumentsType>(_Arguments)] = _Stream.str();
     }
 
+    decltype(auto) GetFeatureType() const
+    {
+        auto _Iterator = _ArgumentsMap.find("-featureType");
+        return _ArgumentsMap.end() == _Iterator ? std::string("HAAR") : _Iterator->second;
+    }
+
+    const boost::filesystem::path& GetDirectory() const
+    {
+        return _Directory;
+    }
+
     static decltype(auto) GetCreatesamplesSet()
     {
         static const std::set<std::string> _CreatesamplesSet =
@@ -277,27 +561,59 @@ public:
             return _List;
         };
 
+        // drop the loaded cascade so the next Predicting picks up the new one
+        _Classifier = cv::CascadeClassifier();
+
         Process<> _Createsamples{ "opencv_createsamples.exe" };
         for (const value_type& _Pair : GetSelectList(GetCreatesamplesSet()))
         {
             _Createsamples.AddArguments(_Pair.first, _Pair.second);
         }
-        _Createsamples.Run();
+        if (!_Createsamples.Run())
+        {
+            return false;
+        }
 
         Process<> _Traincascade{ "opencv_traincascade.exe" };
         for (const value_type& _Pair : GetSelectList(GetTraincascadeSet()))
         {
+            // -mode picks the Haar-like feature set, it means nothing to LBP
+            if ("-mode" == _Pair.first && "HAAR" != GetFeatureType())
+            {
+                continue;
+            }
             _Traincascade.AddArguments(_Pair.first, _Pair.second);
         }
-        _Traincascade.Run();
+        return _Traincascade.Run();
+    }
+
+    // loads a cascade from its XML text, keeping the current one if the text does not parse
+    template<typename TextType>
+    decltype(auto) SetCascade(TextType&& _CascadeText)
+    {
+        cv::FileStorage _Storage(std::forward<TextType>(_CascadeText), cv::FileStorage::READ | cv::FileStorage::MEMORY);
+        cv::CascadeClassifier _Loaded;
+
+        if (!_Storage.isOpened() || !_Loaded.read(_Storage.getFirstTopLevelNode()))
+        {
+            return false;
+        }
+
+        _Classifier = _Loaded;
+        return true;
     }
 
     decltype(auto) Predicting(cv::Mat _Image)
     {
         std::vector<cv::Rect> _vRect;
-        if (boost::filesystem::exists(_CascadeXML))
+        if (_Classifier.empty() && boost::filesystem::exists(_CascadeXML))
+        {
+            _Classifier.load(_CascadeXML.string());
+        }
+
+        if (!_Classifier.empty())
         {
-            cv::CascadeClassifier(_CascadeXML.string()).detectMultiScale(_Image, _vRect);
+            _Classifier.detectMultiScale(_Image, _vRect);
         }
 
         return _vRect;
@@ -311,6 +627,666 @@ private:
     boost::filesystem::path _CascadeXML;
 
     std::map<std::string, std::string> _ArgumentsMap;
+    cv::CascadeClassifier _Classifier;
+};
+
+struct SweepResult
+{
+    std::map<std::string, std::string> _Arguments;
+    bool _Trained = false;
+    double _TrainingSeconds = 0.0;
+    double _DetectionMilliseconds = 0.0;
+    double _HeldOutAccuracy = 0.0;
+    bool _Pareto = false;
+};
+
+class HaarSweep
+{
+public:
+    template<typename PathType>
+    HaarSweep(PathType&& _Path, std::size_t _Cores = std::thread::hardware_concurrency()) :
+        _Directory(std::forward<PathType>(_Path)),
+        _CoreBudget(std::max<std::size_t>(1, _Cores))
+    {
+    }
+
+    template<typename ArgumentsType, typename... Type>
+    decltype(auto) AddGrid(ArgumentsType&& _Arguments, Type&&... _Values)
+    {
+        std::vector<std::string> _ValueList;
+        auto AddString = [&_ValueList](auto&& _Value)
+        {
+            std::ostringstream _Stream;
+            _Stream << std::forward<decltype(_Value)>(_Value);
+            _ValueList.push_back(_Stream.str());
+        };
+
+        int _Dummy[] = { 0, ((void)AddString(std::forward<Type>(_Values)), 0) ... };
+
+        _GridMap[std::forward<ArgumentsType>(_Arguments)] = _ValueList;
+    }
+
+    // Arguments a grid may vary: anything createsamples or traincascade takes,
+    // except the files, sample counts and threads each job gets from the sweep itself.
+    static decltype(auto) IsGridArguments(const std::string& _Arguments)
+    {
+        static const std::set<std::string> _SweepSet =
+        {
+            "-data",
+            "-vec",
+            "-bg",
+            "-info",
+            "-num",
+            "-numPos",
+            "-numNeg",
+            "-numThreads"
+        };
+
+        return
+            0 == _SweepSet.count(_Arguments) &&
+            (0 != Haar::GetCreatesamplesSet().count(_Arguments) || 0 != Haar::GetTraincascadeSet().count(_Arguments));
+    }
+
+    // one argument per line followed by its values, e.g. "-maxDepth 1 2"; '#' starts a comment
+    template<typename PathType>
+    decltype(auto) LoadGrid(PathType&& _Path)
+    {
+        boost::filesystem::path _GridPath(std::forward<PathType>(_Path));
+        std::ifstream _FileStream(_GridPath.native());
+        if (!_FileStream)
+        {
+            std::cerr << "cannot read " << _GridPath.string() << '\n';
+            return false;
+        }
+
+        std::size_t _LineNumber = 0;
+        for (std::string _Line; std::getline(_FileStream, _Line); )
+        {
+            _LineNumber++;
+            std::istringstream _LineStream(_Line.substr(0, _Line.find('#')));
+
+            std::string _Arguments;
+            if (!(_LineStream >> _Arguments))
+            {
+                continue;
+            }
+
+            if (!IsGridArguments(_Arguments))
+            {
+                std::cerr << _GridPath.string() << ':' << _LineNumber << ": " << _Arguments << " cannot be swept: unknown, or set by the sweep itself\n";
+                return false;
+            }
+
+            std::vector<std::string> _ValueList{ std::istream_iterator<std::string>(_LineStream), std::istream_iterator<std::string>() };
+            if (_ValueList.empty())
+            {
+                std::cerr << _GridPath.string() << ':' << _LineNumber << ": " << _Arguments << " has no values\n";
+                return false;
+            }
+
+            _GridMap[_Arguments] = _ValueList;
+        }
+
+        return true;
+    }
+
+    decltype(auto) GetConfigurations() const
+    {
+        std::vector<std::map<std::string, std::string>> _ConfigurationList(1);
+
+        for (auto&& _Pair : _GridMap)
+        {
+            std::vector<std::map<std::string, std::string>> _NextList;
+            for (auto&& _Configuration : _ConfigurationList)
+            {
+                for (auto&& _Value : _Pair.second)
+                {
+                    auto _Copy = _Configuration;
+                    _Copy[_Pair.first] = _Value;
+                    _NextList.push_back(std::move(_Copy));
+                }
+            }
+            _ConfigurationList = std::move(_NextList);
+        }
+
+        return _ConfigurationList;
+    }
+
+    // Trains every configuration of the grid in its own directory, sharing the core budget,
+    // then scores the cascades one at a time so the timings do not disturb each other.
+    decltype(auto) Run(const FileControl& _FileControl)
+    {
+        auto _ConfigurationList = GetConfigurations();
+        std::vector<SweepResult> _ResultList(_ConfigurationList.size());
+
+        boost::filesystem::remove_all(_Directory);
+
+        std::vector<Haar> _HaarList;
+        _HaarList.reserve(_ConfigurationList.size());
+        for (std::size_t _Index = 0; _Index < _ConfigurationList.size(); _Index++)
+        {
+            _HaarList.emplace_back(_Directory / std::to_string(_Index));
+        }
+
+        // every configuration trains on the same samples and is scored on the held-out rest
+        auto&& _PositivesSplit = SplitSamples(_FileControl._PositivesSample);
+        auto&& _NegativesSplit = SplitSamples(_FileControl._NegativesSample);
+
+        auto _JobCount = std::min(_CoreBudget, _ConfigurationList.size());
+        auto _ThreadsPerJob = std::max<std::size_t>(1, _CoreBudget / std::max<std::size_t>(1, _JobCount));
+
+        std::atomic<std::size_t> _NextIndex{ 0 };
+        auto Worker = [&]()
+        {
+            for (std::size_t _Index; (_Index = _NextIndex++) < _ConfigurationList.size(); )
+            {
+                auto& _Haar = _HaarList[_Index];
+                auto& _Result = _ResultList[_Index];
+                _Result._Arguments = _ConfigurationList[_Index];
+
+                _Haar.SetArguments("-numStages", 20);
+                _Haar.SetArguments("-numThreads", _ThreadsPerJob);
+                for (auto&& _Pair : _Result._Arguments)
+                {
+                    _Haar.SetArguments(_Pair.first, _Pair.second);
+                }
+                _Haar.SetPositive(std::begin(_PositivesSplit.first), std::end(_PositivesSplit.first));
+                _Haar.SetNegative(std::begin(_NegativesSplit.first), std::end(_NegativesSplit.first));
+
+                auto _Start = std::chrono::steady_clock::now();
+                _Result._Trained = _Haar.Training();
+                _Result._TrainingSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - _Start).count();
+            }
+        };
+
+        std::vector<std::thread> _ThreadList;
+        for (std::size_t _Index = 0; _Index < _JobCount; _Index++)
+        {
+            _ThreadList.emplace_back(Worker);
+        }
+        for (auto&& _Thread : _ThreadList)
+        {
+            _Thread.join();
+        }
+
+        auto&& _FrameList = GetSpeedFrames(_FileControl);
+        for (std::size_t _Index = 0; _Index < _ResultList.size(); _Index++)
+        {
+            if (_ResultList[_Index]._Trained)
+            {
+                Evaluate(_HaarList[_Index], _PositivesSplit.second, _NegativesSplit.second, _FrameList, _ResultList[_Index]);
+            }
+        }
+
+        MarkPareto(_ResultList);
+        return _ResultList;
+    }
+
+    static decltype(auto) Report(std::ostream& _Stream, const std::vector<SweepResult>& _ResultList)
+    {
+        _Stream << "pareto,trained,training_s,detection_ms,heldout_accuracy,arguments\n";
+
+        for (auto&& _Result : _ResultList)
+        {
+            _Stream <<
+                (_Result._Pareto ? '*' : ' ') << ',' <<
+                _Result._Trained << ',' <<
+                std::fixed << std::setprecision(3) <<
+                _Result._TrainingSeconds << ',' <<
+                _Result._DetectionMilliseconds << ',' <<
+                _Result._HeldOutAccuracy << ',';
+
+            for (auto&& _Pair : _Result._Arguments)
+            {
+                _Stream << _Pair.first << ' ' << _Pair.second << ' ';
+            }
+            _Stream << '\n';
+        }
+    }
+
+    const boost::filesystem::path& GetDirectory() const
+    {
+        return _Directory;
+    }
+
+private:
+    // fixed split: every _HoldOutStride-th sample is kept out of training
+    std::pair<std::vector<std::string>, std::vector<std::string>> SplitSamples(const std::vector<std::string>& _SampleList) const
+    {
+        std::pair<std::vector<std::string>, std::vector<std::string>> _Split;
+
+        for (std::size_t _Index = 0; _Index < _SampleList.size(); _Index++)
+        {
+            auto& _List = _HoldOutStride - 1 == _Index % _HoldOutStride ? _Split.second : _Split.first;
+            _List.push_back(_SampleList[_Index]);
+        }
+
+        return _Split;
+    }
+
+    std::vector<cv::Mat> GetSpeedFrames(const FileControl& _FileControl) const
+    {
+        std::vector<cv::Mat> _FrameList;
+
+        auto _FrameCount = std::min(_SpeedFrameCount, _FileControl._PredictionArchive.size());
+        for (std::size_t _Index = 0; _Index < _FrameCount; _Index++)
+        {
+            _FrameList.push_back(_FileControl._PredictionArchive.Read(_Index));
+        }
+
+        if (_FrameList.empty())
+        {
+            for (auto&& _File : _FileControl._NegativesSample)
+            {
+                _FrameList.push_back(cv::imread(_File));
+            }
+        }
+
+        return _FrameList;
+    }
+
+    static void Evaluate(
+        Haar& _Haar,
+        const std::vector<std::string>& _PositivesList,
+        const std::vector<std::string>& _NegativesList,
+        const std::vector<cv::Mat>& _FrameList,
+        SweepResult& _Result)
+    {
+        std::size_t _Correct = 0;
+        for (auto&& _File : _PositivesList)
+        {
+            _Correct += _Haar.Predicting(cv::imread(_File)).empty() ? 0 : 1;
+        }
+        for (auto&& _File : _NegativesList)
+        {
+            _Correct += _Haar.Predicting(cv::imread(_File)).empty() ? 1 : 0;
+        }
+
+        auto _Total = _PositivesList.size() + _NegativesList.size();
+        _Result._HeldOutAccuracy = 0 < _Total ? static_cast<double>(_Correct) / _Total : 0.0;
+
+        if (!_FrameList.empty())
+        {
+            auto _Start = std::chrono::steady_clock::now();
+            for (auto&& _Frame : _FrameList)
+            {
+                _Haar.Predicting(_Frame);
+            }
+            auto _Elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - _Start).count();
+
+            _Result._DetectionMilliseconds = _Elapsed / _FrameList.size();
+        }
+    }
+
+    static void MarkPareto(std::vector<SweepResult>& _ResultList)
+    {
+        for (auto&& _Result : _ResultList)
+        {
+            _Result._Pareto = _Result._Trained && std::none_of(std::begin(_ResultList), std::end(_ResultList), [&](auto&& _Other)
+            {
+                return
+                    _Other._Trained &&
+                    _Other._HeldOutAccuracy >= _Result._HeldOutAccuracy &&
+                    _Other._DetectionMilliseconds <= _Result._DetectionMilliseconds &&
+                    (_Other._HeldOutAccuracy > _Result._HeldOutAccuracy || _Other._DetectionMilliseconds < _Result._DetectionMilliseconds);
+            });
+        }
+    }
+
+    boost::filesystem::path _Directory;
+    std::size_t _CoreBudget;
+    std::size_t _SpeedFrameCount = 100;
+    std::size_t _HoldOutStride = 5;
+    std::map<std::string, std::vector<std::string>> _GridMap;
+};
+
+class LatencyStats
+{
+public:
+    decltype(auto) Add(double _Microseconds)
+    {
+        std::lock_guard<std::mutex> _Lock(_Mutex);
+        _SampleList.push_back(_Microseconds);
+    }
+
+    // prints and clears the samples gathered since the last report
+    decltype(auto) Report(std::ostream& _Stream)
+    {
+        std::vector<double> _List;
+        {
+            std::lock_guard<std::mutex> _Lock(_Mutex);
+            _List.swap(_SampleList);
+        }
+
+        if (_List.empty())
+        {
+            return;
+        }
+
+        std::sort(std::begin(_List), std::end(_List));
+        auto GetPercentile = [&_List](double _Percent)
+        {
+            return _List[static_cast<std::size_t>(_Percent * (_List.size() - 1))];
+        };
+
+        auto _Sum = std::accumulate(std::begin(_List), std::end(_List), 0.0);
+
+        _Stream << std::fixed << std::setprecision(1) <<
+            "requests " << _List.size() <<
+            " mean " << _Sum / _List.size() << "us" <<
+            " p50 " << GetPercentile(0.50) << "us" <<
+            " p99 " << GetPercentile(0.99) << "us" <<
+            " max " << _List.back() << "us" << '\n';
+    }
+
+private:
+    std::mutex _Mutex;
+    std::vector<double> _SampleList;
+};
+
+class DetectionService
+{
+public:
+    template<typename PathType>
+    DetectionService(PathType&& _Path, std::size_t _Workers = std::thread::hardware_concurrency()) :
+        _CascadeXML(boost::filesystem::path(std::forward<PathType>(_Path)) / "cascade.xml"),
+        _WorkerCount(std::max<std::size_t>(1, _Workers))
+    {
+        RemoveStaleRing();
+
+        _SharedMemory = boost::interprocess::shared_memory_object(
+            boost::interprocess::create_only, DetectionRing::GetName(), boost::interprocess::read_write);
+        _SharedMemory.truncate(sizeof(DetectionRing));
+        _Region = boost::interprocess::mapped_region(_SharedMemory, boost::interprocess::read_write);
+
+        _Ring = new (_Region.get_address()) DetectionRing;
+        _Ring->_Running = true;
+        for (auto&& _Slot : _Ring->_Slots)
+        {
+            _Slot._State = DetectionSlot::Free;
+            _Slot._Sequence = 0;
+        }
+
+        _Ring->_Header._Version = DetectionRing::Version;
+        _Ring->_Header._Size = sizeof(DetectionRing);
+        _Ring->_Header._BoostVersion = BOOST_VERSION;
+        _Ring->_Header._HeartbeatTicks = DetectionRing::GetTicks();
+        _Ring->_Header._Magic = DetectionRing::Magic;
+
+        ReloadCascade();
+    }
+
+    DetectionService(const DetectionService&) = delete;
+    DetectionService& operator=(const DetectionService&) = delete;
+
+    ~DetectionService()
+    {
+        Stop();
+        for (auto&& _Thread : _ThreadList)
+        {
+            _Thread.join();
+        }
+
+        // The mutex and conditions are left alone: attached clients may still be waking from them.
+        // Removing the name is enough, the memory goes away with the last mapping.
+        boost::interprocess::shared_memory_object::remove(DetectionRing::GetName());
+    }
+
+    void Stop()
+    {
+        boost::interprocess::scoped_lock<boost::interprocess::interprocess_mutex> _Lock(_Ring->_Mutex);
+        _Ring->_Running = false;
+        _Ring->_RequestCondition.notify_all();
+        _Ring->_ResponseCondition.notify_all();
+    }
+
+    // Serves requests until Stop() or Ctrl+C / console close, checking cascade.xml for a new model,
+    // reclaiming stale slots and printing latency once per interval.
+    decltype(auto) Run(std::chrono::milliseconds _Interval = std::chrono::milliseconds(1000))
+    {
+        GetStopSignal() = 0;
+        std::signal(SIGINT, OnSignal);
+        std::signal(SIGTERM, OnSignal);
+#ifdef SIGBREAK
+        std::signal(SIGBREAK, OnSignal);
+#endif
+
+        for (std::size_t _Index = 0; _Index < _WorkerCount; _Index++)
+        {
+            _ThreadList.emplace_back([this] { Work(); });
+        }
+
+        auto _NextReport = std::chrono::steady_clock::now() + _Interval;
+        while (IsRunning())
+        {
+            // short steps so a console close is handled before the system kills the process
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            _Ring->_Header._HeartbeatTicks = DetectionRing::GetTicks();
+
+            if (GetStopSignal())
+            {
+                Stop();
+                break;
+            }
+
+            if (std::chrono::steady_clock::now() < _NextReport)
+            {
+                continue;
+            }
+            _NextReport += _Interval;
+
+            ReloadCascade();
+            ReclaimSlots();
+            _LatencyStats.Report(std::cout);
+        }
+    }
+
+private:
+    struct CascadeModel
+    {
+        std::size_t _Generation;
+        std::string _Text;
+    };
+
+    static volatile std::sig_atomic_t& GetStopSignal()
+    {
+        static volatile std::sig_atomic_t _StopSignal = 0;
+        return _StopSignal;
+    }
+
+    static void OnSignal(int)
+    {
+        GetStopSignal() = 1;
+    }
+
+    // Takes the segment name over from a crashed service; throws when a live one still beats on it.
+    void RemoveStaleRing()
+    {
+        try
+        {
+            boost::interprocess::shared_memory_object _Existing(
+                boost::interprocess::open_only, DetectionRing::GetName(), boost::interprocess::read_only);
+            boost::interprocess::mapped_region _ExistingRegion(_Existing, boost::interprocess::read_only);
+
+            if (DetectionRing::IsAlive(_ExistingRegion.get_address(), _ExistingRegion.get_size(), _HeartbeatTimeout))
+            {
+                throw std::runtime_error("a detection service is already running");
+            }
+        }
+        catch (const boost::interprocess::interprocess_exception&)
+        {
+            // no segment, or an empty one
+        }
+
+        boost::interprocess::shared_memory_object::remove(DetectionRing::GetName());
+    }
+
+    bool IsRunning()
+    {
+        boost::interprocess::scoped_lock<boost::interprocess::interprocess_mutex> _Lock(_Ring->_Mutex);
+        return _Ring->_Running;
+    }
+
+    // Publishes cascade.xml when its text changed and parses, so the workers never see a half-written model.
+    void ReloadCascade()
+    {
+        boost::system::error_code _TimeError, _SizeError;
+        auto _WriteTime = boost::filesystem::last_write_time(_CascadeXML, _TimeError);
+        auto _Size = boost::filesystem::file_size(_CascadeXML, _SizeError);
+        if (_TimeError || _SizeError)
+        {
+            return;
+        }
+
+        // the write time has one second resolution, so a file written in the second of the last read
+        // is read again until the check is past that second
+        if (_WriteTime == _CascadeWriteTime && _Size == _CascadeSize && _WriteTime < _CascadeCheckTime)
+        {
+            return;
+        }
+        _CascadeWriteTime = _WriteTime;
+        _CascadeSize = _Size;
+        _CascadeCheckTime = std::time(nullptr);
+
+        std::ifstream _FileStream(_CascadeXML.native());
+        std::string _Text{ std::istreambuf_iterator<char>(_FileStream), std::istreambuf_iterator<char>() };
+
+        auto _Current = std::atomic_load(&_Model);
+        if (_Current && _Current->_Text == _Text)
+        {
+            return;
+        }
+
+        Haar _Haar;
+        if (!_Haar.SetCascade(_Text))
+        {
+            return;
+        }
+
+        auto _Generation = _Current ? _Current->_Generation + 1 : 1;
+        std::atomic_store(&_Model, std::make_shared<const CascadeModel>(CascadeModel{ _Generation, std::move(_Text) }));
+
+        std::cout << "loaded " << _CascadeXML.string() << " generation " << _Generation << '\n';
+    }
+
+    // frees slots whose client stopped filling or collecting them
+    void ReclaimSlots()
+    {
+        auto _Lease = std::chrono::duration_cast<std::chrono::nanoseconds>(_SlotLease).count();
+        auto _Ticks = DetectionRing::GetTicks();
+        bool _Reclaimed = false;
+
+        boost::interprocess::scoped_lock<boost::interprocess::interprocess_mutex> _Lock(_Ring->_Mutex);
+        for (auto&& _Slot : _Ring->_Slots)
+        {
+            if ((DetectionSlot::Writing == _Slot._State || DetectionSlot::Done == _Slot._State) &&
+                _Lease < _Ticks - _Slot._StateTicks)
+            {
+                _Slot._State = DetectionSlot::Free;
+                _Reclaimed = true;
+            }
+        }
+
+        if (_Reclaimed)
+        {
+            _Ring->_ResponseCondition.notify_all();
+        }
+    }
+
+    // oldest submitted request first; call with the ring locked
+    std::size_t ClaimSlot()
+    {
+        auto _Claimed = DetectionRing::SlotCount;
+        for (std::size_t _Index = 0; _Index < DetectionRing::SlotCount; _Index++)
+        {
+            auto& _Slot = _Ring->_Slots[_Index];
+            if (DetectionSlot::Ready == _Slot._State &&
+                (DetectionRing::SlotCount == _Claimed || _Slot._SubmitTicks < _Ring->_Slots[_Claimed]._SubmitTicks))
+            {
+                _Claimed = _Index;
+            }
+        }
+
+        if (DetectionRing::SlotCount != _Claimed)
+        {
+            _Ring->_Slots[_Claimed]._State = DetectionSlot::Busy;
+        }
+
+        return _Claimed;
+    }
+
+    // One request per wakeup: detectMultiScale has no shared setup to amortize,
+    // so handing each request to its own worker keeps the pool parallel.
+    void Work()
+    {
+        Haar _Haar;
+        std::size_t _Generation = 0;
+
+        while (true)
+        {
+            auto _Index = DetectionRing::SlotCount;
+            {
+                boost::interprocess::scoped_lock<boost::interprocess::interprocess_mutex> _Lock(_Ring->_Mutex);
+                while (_Ring->_Running && DetectionRing::SlotCount == (_Index = ClaimSlot()))
+                {
+                    _Ring->_RequestCondition.wait(_Lock);
+                }
+
+                if (DetectionRing::SlotCount == _Index)
+                {
+                    return;
+                }
+            }
+
+            auto _Model = std::atomic_load(&this->_Model);
+            if (_Model && _Model->_Generation != _Generation)
+            {
+                _Haar.SetCascade(_Model->_Text);
+                _Generation = _Model->_Generation;
+            }
+
+            auto& _Slot = _Ring->_Slots[_Index];
+            cv::Mat _Image(_Slot._Height, _Slot._Width, CV_8UC1, _Slot._Pixels);
+
+            auto&& _vRect = _Haar.Predicting(_Image);
+            _Slot._RectCount = static_cast<std::uint32_t>(std::min(_vRect.size(), static_cast<std::size_t>(DetectionSlot::MaxRects)));
+            for (std::size_t _Rect = 0; _Rect < _Slot._RectCount; _Rect++)
+            {
+                _Slot._Rects[_Rect][0] = _vRect[_Rect].x;
+                _Slot._Rects[_Rect][1] = _vRect[_Rect].y;
+                _Slot._Rects[_Rect][2] = _vRect[_Rect].width;
+                _Slot._Rects[_Rect][3] = _vRect[_Rect].height;
+            }
+
+            std::int64_t _LatencyMicroseconds = 0;
+            {
+                boost::interprocess::scoped_lock<boost::interprocess::interprocess_mutex> _Lock(_Ring->_Mutex);
+
+                // stamped together with Done, which is when the client can see the result
+                _Slot._StateTicks = DetectionRing::GetTicks();
+                _Slot._LatencyMicroseconds = _LatencyMicroseconds = (_Slot._StateTicks - _Slot._SubmitTicks) / 1000;
+                _Slot._State = _Slot._Abandoned ? DetectionSlot::Free : DetectionSlot::Done;
+                _Ring->_ResponseCondition.notify_all();
+            }
+            _LatencyStats.Add(static_cast<double>(_LatencyMicroseconds));
+        }
+    }
+
+    boost::filesystem::path _CascadeXML;
+    std::time_t _CascadeWriteTime = 0;
+    std::time_t _CascadeCheckTime = 0;
+    boost::uintmax_t _CascadeSize = 0;
+    std::shared_ptr<const CascadeModel> _Model;
+
+    std::size_t _WorkerCount;
+    std::chrono::seconds _SlotLease{ 10 };
+    std::chrono::seconds _HeartbeatTimeout{ 2 };
+    std::vector<std::thread> _ThreadList;
+    LatencyStats _LatencyStats;
+
+    boost::interprocess::shared_memory_object _SharedMemory;
+    boost::interprocess::mapped_region _Region;
+    DetectionRing* _Ring = nullptr;
 };
 
 decltype(auto) BlurImage(cv::Mat _OriginImage)
@@ -362,18 +1338,18 @@ class GUIControl
 public:
     decltype(auto) GetCurrentPrediction()
     {
-        return cv::imread(_FileControl._PredictionSample[_FrameIndex]);
+        return _FileControl._PredictionArchive.Read(_FrameIndex);
     }
 
-    GUIControl(const cv::String& _wName) :
+    GUIControl(const cv::String& _wName, const std::string& _FeatureType = "HAAR") :
         _windowsMap(cv::Size(960, 640), CV_8UC3),
         _windowsName(_wName),
-        _Haar("Haar"),
+        _Haar("HAAR" == _FeatureType ? "Haar" : _FeatureType, _FeatureType),
         _FrameIndex(44),
         _SelectMethod(1),
         _SelectFlog(false)
     {
-        if (_FrameIndex < _FileControl._PredictionSample.size())
+        if (_FrameIndex < _FileControl._PredictionArchive.size())
         {
             auto&& _Mat = GetCurrentPrediction();
             _Mat.copyTo(_windowsMap(_vectorRect[0]));
@@ -391,7 +1367,7 @@ public:
 
     decltype(auto) HaarTraining()
     {
-        auto&& _List = GetFileList("Haar");
+        auto&& _List = GetFileList(_Haar.GetDirectory());
         for (auto&& _File : _List)
         {
             boost::filesystem::remove(_File);
@@ -554,7 +1530,7 @@ public:
         {
             _White[7].copyTo(_windowsMap(_vectorRect[7]));
 
-            if (_FrameIndex + 1 < _FileControl._PredictionSample.size())
+            if (_FrameIndex + 1 < _FileControl._PredictionArchive.size())
             {
                 _FrameIndex++;
                 auto&& _Mat = GetCurrentPrediction();
@@ -694,11 +1670,13 @@ private:
     }
 };
 
-decltype(auto) VideoCapture(const cv::String &_FileName = "V_20171215_234658_vHDR_Auto_OC0.mp4")
+decltype(auto) VideoCapture(
+    const cv::String &_FileName = "V_20171215_234658_vHDR_Auto_OC0.mp4",
+    const boost::filesystem::path &_ArchiveName = "Prediction.frames")
 {
     cv::VideoCapture _VideoCapture(_FileName);
+    FrameArchiveWriter _Writer(_ArchiveName);
 
-    std::size_t _Size = 0;
     while (true)
     {
         cv::Mat _Frame;
@@ -709,17 +1687,94 @@ decltype(auto) VideoCapture(const cv::String &_FileName = "V_20171215_234658_vHD
         cv::resize(_Frame, _Frame, cv::Size(640, 480));
         cv::cvtColor(_Frame, _Frame, CV_BGR2GRAY);
 
-        auto _Path = std::string("Prediction\\") + std::to_string(_Size++) + ".bmp";
-        cv::imwrite(_Path, _Frame);
+        _Writer.Append(_Frame);
         cv::imshow("windows", _Frame);
         cv::waitKey(1);
     }
 }
 
-int main()
+decltype(auto) RunSweep(HaarSweep& _Sweep)
+{
+    FileControl _FileControl;
+    auto&& _ResultList = _Sweep.Run(_FileControl);
+
+    HaarSweep::Report(std::cout, _ResultList);
+    std::ofstream _FileStream((_Sweep.GetDirectory() / "report.csv").native());
+    HaarSweep::Report(_FileStream, _ResultList);
+}
+
+// without a grid file, sweeps the settings HaarTraining hard-codes
+decltype(auto) TrainingSweep(const std::string& _GridFile = "", std::size_t _Cores = std::thread::hardware_concurrency())
 {
+    HaarSweep _Sweep("Sweep", _Cores);
+
+    if (_GridFile.empty())
+    {
+        _Sweep.AddGrid("-weightTrimRate", 0.9, 0.95);
+        _Sweep.AddGrid("-maxDepth", 1, 2);
+        _Sweep.AddGrid("-maxWeakCount", 50, 100);
+    }
+    else if (!_Sweep.LoadGrid(_GridFile))
+    {
+        return false;
+    }
+
+    RunSweep(_Sweep);
+    return true;
+}
+
+// trains HAAR and LBP on the bundled samples side by side
+decltype(auto) CompareFeatureTypes(std::size_t _Cores = std::thread::hardware_concurrency())
+{
+    HaarSweep _Sweep("Compare", _Cores);
+
+    _Sweep.AddGrid("-featureType", "HAAR", "LBP");
+
+    RunSweep(_Sweep);
+}
+
+int main(int argc, char* argv[])
+{
+    std::string _Mode = 1 < argc ? argv[1] : "";
+    std::string _Value = 2 < argc ? argv[2] : "";
+
+    if ("--service" == _Mode)
+    {
+        try
+        {
+            DetectionService _Service(_Value.empty() ? "Haar" : _Value);
+            _Service.Run();
+        }
+        catch (const std::exception& _Exception)
+        {
+            std::cerr << _Exception.what() << '\n';
+            return 1;
+        }
+        return 0;
+    }
+    else if ("--sweep" == _Mode)
+    {
+        std::size_t _Cores = std::thread::hardware_concurrency();
+        if (3 < argc)
+        {
+            std::istringstream _Stream(argv[3]);
+            if ('-' == argv[3][0] || !(_Stream >> _Cores) || !_Stream.eof() || 0 == _Cores)
+            {
+                std::cerr << "usage: --sweep [grid file] [cores]\n";
+                return 1;
+            }
+        }
+
+        return TrainingSweep(_Value, _Cores) ? 0 : 1;
+    }
+    else if ("--compare" == _Mode)
+    {
+        CompareFeatureTypes();
+        return 0;
+    }
+
     cv::String windowname = "windows";
-    GUIControl _MouseControl(windowname);
+    GUIControl _MouseControl(windowname, "--lbp" == _Mode ? "LBP" : "HAAR");
 
     do
     {